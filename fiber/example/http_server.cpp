@@ -1,17 +1,49 @@
 
+#include <string>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "fiber.hpp"
 #include "kernel.hpp"
 #include "socketstream.hpp"
 
+static std::string http_root = ".";
+
+bool http_server_send_file(fiber::tcpstream& stream, const std::string& path) {
+    int fd = -1;
+    struct stat st;
+    if (path.find("..") == std::string::npos) {
+        fd = ::open((http_root + path).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1 || ::fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) {
+            ::close(fd);
+        }
+        stream << "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n" << std::flush;
+        return stream.good();
+    }
+    stream << "HTTP/1.1 200 OK\r\nContent-Length: " << st.st_size << "\r\n\r\n" << std::flush;
+    //body goes file -> socket in the kernel
+    bool ok = stream.good() && stream.socket()->send_file(fd, 0, st.st_size) == st.st_size;
+    ::close(fd);
+    return ok;
+}
+
 void http_server_handle(fiber::tcpstream& stream, fiber::socketaddr& addr) {
     std::string line;
     std::cout << addr << "(begin)" << std::endl;
     while (std::getline(stream, line)) {
-        line.pop_back();
-        std::cout << addr << "> " << line << '(' << line.length() << ')' << std::endl;
-        stream << line << std::endl; 
-        //stream << line << std::endl; 
+        std::string method, path;
+        std::istringstream(line) >> method >> path;
+        std::cout << addr << "> " << method << ' ' << path << std::endl;
+        while (std::getline(stream, line) && line != "\r" && !line.empty()) {
+            //skip headers
+        }
+        if (method != "GET" || !http_server_send_file(stream, path)) {
+            break;
+        }
     }
     std::cout << addr << "(end)" << std::endl;
 }
@@ -20,14 +52,18 @@ void http_server_main(int port) {
     fiber::tcpacceptor acceptor(port);
     std::cout << "tcpacceptor listen on: " << port << std::endl;
 
-    acceptor(echo_server_handle);
+    acceptor(http_server_handle);
 }
 
 int main(int argc, char* argv[]) {
 
     if (argc < 2) {
-        std::cout << "usage: " << argv[0] << " <port>" << std::endl;
-        return 1; 
+        std::cout << "usage: " << argv[0] << " <port> [root]" << std::endl;
+        return 1;
+    }
+
+    if (argc > 2) {
+        http_root = argv[2];
     }
 
     fiber::fiber(http_server_main, std::atoi(argv[1]));
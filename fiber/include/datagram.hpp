@@ -0,0 +1,234 @@
+
+
+#ifndef FIBER_DATAGRAM_HPP
+#define FIBER_DATAGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+
+#include "socket.hpp"
+
+namespace fiber {
+
+//splits a GRO coalesced buffer back into datagrams of segment bytes, the last may be shorter
+class datagram_segments {
+public:
+    struct value_type {
+        const char *data;
+        std::size_t size;
+    };
+
+    class iterator {
+        const char *__pos;
+        const char *__end;
+        std::size_t __segment;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef datagram_segments::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef value_type reference;
+
+        iterator(const char *pos, const char *end, std::size_t segment) noexcept: __pos(pos), __end(end), __segment(segment) { }
+
+        value_type operator*() const noexcept {
+            return value_type{ __pos, std::min<std::size_t>(__segment, __end - __pos) };
+        }
+
+        iterator& operator++() noexcept { 
+            __pos += std::min<std::size_t>(__segment, __end - __pos); 
+            return *this; 
+        }
+
+        iterator operator++(int) noexcept { iterator it(*this); ++*this; return it; }
+
+        bool operator==(const iterator& it) const noexcept { return __pos == it.__pos; }
+
+        bool operator!=(const iterator& it) const noexcept { return __pos != it.__pos; }
+    };
+
+private:
+    const char *__data;
+    std::size_t __size;
+    std::size_t __segment;
+
+public:
+    datagram_segments(const char *data, std::size_t size, std::size_t segment) noexcept: 
+        __data(data), __size(size), __segment(segment ? segment : size) { }
+
+    iterator begin() const noexcept { return iterator(__data, __data + __size, __segment); }
+
+    iterator end() const noexcept { return iterator(__data + __size, __data + __size, __segment); }
+
+    std::size_t size() const noexcept { return __segment ? (__size + __segment - 1) / __segment : 0; }
+
+    bool empty() const noexcept { return __size == 0; }
+};
+
+//N datagrams with peer addrs moved by one recvmmsg/sendmmsg, all storage preallocated,
+//payload buffers live on the heap to keep fiber stacks small
+template<class SocketT, std::size_t N = 64, std::size_t BufSize = 2048>
+class basic_mmsgbuf {
+public:
+    typedef SocketT socket_type;
+    typedef typename socket_type::socketaddr_type socketaddr_type;
+
+    static constexpr const std::size_t max_count = N;
+    static constexpr const std::size_t buffer_size = BufSize;
+
+private:
+    mmsghdr __msgs[N];
+    iovec __iovs[N];
+    socketaddr_type __addrs[N];
+    //UDP_SEGMENT (uint16_t) on send, UDP_GRO (int) on recv
+    struct alignas(cmsghdr) {
+        char buf[CMSG_SPACE(sizeof(int))];
+    } __ctrls[N];
+    uint16_t __segments[N];
+    std::unique_ptr<char[]> __bufs;
+    std::size_t __count;
+
+    void __reset(std::size_t i, std::size_t len) noexcept {
+        __iovs[i].iov_len = len;
+        __msgs[i].msg_hdr.msg_namelen = socketaddr_type::native_max_socklen;
+        __msgs[i].msg_hdr.msg_control = __ctrls[i].buf;
+        __msgs[i].msg_hdr.msg_controllen = sizeof(__ctrls[i].buf);
+        __msgs[i].msg_hdr.msg_flags = 0;
+        __msgs[i].msg_len = 0;
+        __segments[i] = 0;
+    }
+
+    void __set_segment(std::size_t i, uint16_t segment) noexcept {
+        msghdr& hdr = __msgs[i].msg_hdr;
+        if (!segment) {
+            hdr.msg_control = nullptr;
+            hdr.msg_controllen = 0;
+            return;
+        }
+        hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+        __segments[i] = segment;
+    }
+
+    void __get_segment(std::size_t i) noexcept {
+        msghdr& hdr = __msgs[i].msg_hdr;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int segment;
+                std::memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+                __segments[i] = static_cast<uint16_t>(segment);
+            }
+        }
+    }
+
+public:
+    basic_mmsgbuf(): __bufs(new char[N * BufSize]), __count(0) {
+        std::memset(__msgs, 0, sizeof(__msgs));
+        for (std::size_t i = 0; i < N; ++i) {
+            __iovs[i].iov_base = &__bufs[i * BufSize];
+            __msgs[i].msg_hdr.msg_name = __addrs[i].native_sockaddr();
+            __msgs[i].msg_hdr.msg_iov = &__iovs[i];
+            __msgs[i].msg_hdr.msg_iovlen = 1;
+            __reset(i, BufSize);
+        }
+    }
+
+    //hdrs point into this object
+    basic_mmsgbuf(const basic_mmsgbuf&) = delete;
+
+    basic_mmsgbuf& operator=(const basic_mmsgbuf&) = delete;
+
+    std::size_t size() const noexcept { return __count; }
+
+    bool empty() const noexcept { return __count == 0; }
+
+    bool full() const noexcept { return __count == N; }
+
+    void clear() noexcept { __count = 0; }
+
+    const char* data(std::size_t i) const noexcept { return &__bufs[i * BufSize]; }
+
+    std::size_t length(std::size_t i) const noexcept { return __iovs[i].iov_len; }
+
+    const socketaddr_type& addr(std::size_t i) const noexcept { return __addrs[i]; }
+
+    //datagram was longer than BufSize and cut
+    bool truncated(std::size_t i) const noexcept { return __msgs[i].msg_hdr.msg_flags & MSG_TRUNC; }
+
+    //GSO/GRO segment size of slot i, or its length when not coalesced
+    std::size_t segment(std::size_t i) const noexcept { return __segments[i] ? __segments[i] : length(i); }
+
+    datagram_segments segments(std::size_t i) const noexcept { return datagram_segments(data(i), length(i), segment(i)); }
+
+    //queue a copy of buf for the next send, a nonzero segment lets the kernel 
+    //split it into datagrams of that size (UDP_SEGMENT, at most 64 per buffer)
+    bool push(const void *buf, std::size_t len, const socketaddr_type& addr, uint16_t segment = 0) noexcept {
+        if (full() || len > BufSize) {
+            return false;
+        }
+        std::memcpy(&__bufs[__count * BufSize], buf, len);
+        __addrs[__count] = addr;
+        __reset(__count, len);
+        __msgs[__count].msg_hdr.msg_namelen = addr.socklen();
+        __set_segment(__count, segment < len ? segment : 0);
+        ++__count;
+        return true;
+    }
+
+    //fill with up to N datagrams, return count or -1
+    int recv(socket_type& s, int flags = MSG_WAITFORONE) {
+        for (std::size_t i = 0; i < N; ++i) {
+            __reset(i, BufSize);
+        }
+        int ret = s.recvmmsg(__msgs, N, flags);
+        __count = ret > 0 ? ret : 0;
+        for (std::size_t i = 0; i < __count; ++i) {
+            __iovs[i].iov_len = __msgs[i].msg_len;
+            __addrs[i].socklen(__msgs[i].msg_hdr.msg_namelen);
+            __get_segment(i);
+        }
+        return ret;
+    }
+
+    //send all queued datagrams and clear, unsent ones are dropped on error, return sent count or -1
+    int send(socket_type& s, int flags = 0) {
+        std::size_t sent = 0;
+        while (sent < __count) {
+            int ret = s.sendmmsg(__msgs + sent, __count - sent, flags);
+            if (ret <= 0) {
+                break;
+            }
+            sent += ret;
+        }
+        std::size_t count = __count;
+        __count = 0;
+        return sent || !count ? static_cast<int>(sent) : -1;
+    }
+};
+
+
+typedef basic_mmsgbuf<udpsocket> udpmmsgbuf;
+typedef basic_mmsgbuf<udp6socket> udp6mmsgbuf;
+
+//slots large enough for a full GSO/GRO buffer
+typedef basic_mmsgbuf<udpsocket, 16, 65536> udpgsobuf;
+typedef basic_mmsgbuf<udp6socket, 16, 65536> udp6gsobuf;
+
+
+}
+
+
+#endif //FIBER_DATAGRAM_HPP
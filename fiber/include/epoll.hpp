@@ -3,10 +3,10 @@
 #ifndef FIBER_EPOLL_HPP
 #define FIBER_EPOLL_HPP
 
-#include <string>
-#include <iostream>
-#include <type_traits>
+#include <cstdint>
+#include <cerrno>
 
+#include <unistd.h>
 #include <sys/epoll.h>
 
 namespace fiber {
@@ -18,31 +18,36 @@ class __reactor_base {
 class epoll_base: public __reactor_base {
 public:
     typedef int native_handle_type;
-    typedef epoll_event native_event_type; 
-    typedef int native_events_type; 
+    typedef epoll_event native_event_type;
+    typedef uint32_t events_type;
 
     static const int max_size = 1000;
-    
+
 protected:
     native_handle_type __epoll;
 
 protected:
-    basic_epoll() noexcept: __epoll(-1) {}
+    epoll_base() noexcept: __epoll(-1) {}
+
+    explicit epoll_base(native_handle_type ep) noexcept: __epoll(ep) { }
+
+    epoll_base(const epoll_base&) = delete;
 
-    basic_epoll(native_handle_type ep) noexcept: __epoll(ep) { }
+    ~epoll_base() noexcept { if (is_open()) { close(); } }
 
-    ~basic_epoll() noexcept { if (is_open()) { close(); } }
+    epoll_base& operator=(const epoll_base&) = delete;
 
+public:
     bool is_open() const noexcept { return __epoll >= 0; }
 
     bool close() noexcept {
-        bool ret = ::close(__epoll) != -1; 
+        bool ret = ::close(__epoll) != -1;
         __epoll = -1;
         return ret;
     }
 
     bool open() noexcept {
-        __epoll = ::epoll_create(max_size); 
+        __epoll = ::epoll_create1(EPOLL_CLOEXEC);
         return is_open();
     }
 
@@ -50,113 +55,57 @@ protected:
 
 };
 
-template<EventT>
+template<class EventT>
 class basic_epoll: public epoll_base {
 
 public:
     typedef EventT event_type;
-    typedef std::queue<event_type*> event_queue_type;
 
     static constexpr const int max_wait_event = 256;
 
-    static int default_wait_timeout = 0; 
+    static constexpr const int default_wait_timeout = -1;
 
 private:
     native_event_type __events[max_wait_event];
 
+    bool __ctl(int op, int fd, events_type events, event_type *event) noexcept {
+        native_event_type ev = { 0, { 0 } };
+        ev.events = events;
+        ev.data.ptr = event;
+        return ::epoll_ctl(__epoll, op, fd, &ev) != -1;
+    }
+
 public:
-    event_queue_type wait(int timeout = default_wait_timeout) noexcept {
-        event_queue_type event_queue;
-        int event_cnt = ::epoll_wait(this->__epoll, __events, max_wait_event, timeout);
+    basic_epoll() noexcept: epoll_base() { this->open(); }
+
+    //fn(event_type*, events_type) for every ready event, return count or -1
+    template<class Fn>
+    int wait(Fn&& fn, int timeout = default_wait_timeout) {
+        int event_cnt = ::epoll_wait(__epoll, __events, max_wait_event, timeout);
         if (event_cnt == -1) {
-            //error
-            return event_queue;
+            return errno == EINTR ? 0 : -1;
         }
         for (int i = 0; i < event_cnt; ++i) {
-            event_type* event = reinterpret_cast<event_type*>(__events[i].data.ptr);
-            event_queue.push(event);
+            fn(reinterpret_cast<event_type*>(__events[i].data.ptr), __events[i].events);
         }
-        return event_queue;
+        return event_cnt;
     }
 
-    bool push(event_type *event) {
-        native_event_type ev = { 0, { 0 } };
-        ev.events = EPOLLIN | EPOLLERR | EPOLLET;
-        ev.data.ptr = event;
-        return ::epoll_ctl(__epoll, EPOLL_CTL_ADD, event->socket()->native_handle(), &ev) != -1;
+    bool push(int fd, events_type events, event_type *event) noexcept {
+        return __ctl(EPOLL_CTL_ADD, fd, events, event);
     }
 
-    bool remove(event_type *event) {
-        native_event_type ev; //linux 2.6.9
-        return ::epoll_ctl(__epoll, EPOLL_CTL_DEL, event->socket()->native_handle(), &ev) != -1;
+    bool modify(int fd, events_type events, event_type *event) noexcept {
+        return __ctl(EPOLL_CTL_MOD, fd, events, event);
     }
-};
-
-
-class __event_base {
-    typedef const void* native_handle_type;
-
-protected:
-    class __impl_base; 
 
-    template<class Fn>
-    class __basic_impl;
-};
-
-class __event_base::__impl_base {
-    virtual void __complete() = 0;
-
-    native_handle_type __native_handle() { return native_handle_type(this); }
-};
-
-template<class Fn>
-class __event_base::__basic_impl {
-    socket_base __socket;
-    Fn __fn;
-
-public:
-    void __complete() override {
-        __fn();
+    bool remove(int fd) noexcept {
+        return __ctl(EPOLL_CTL_DEL, fd, 0, nullptr); //linux 2.6.9
     }
 };
 
-class event: public __event_base {
-    std::shared_ptr<__impl_base> __impl;
-
-public:
-    class id {
-        native_handle_type __event;
-
-    public:
-        id(): __event(0) { }
-
-        explicit id(native_handle_type e): __event(e) { }
-
-        native_handle_type native_handle() const { return __event; }
-    };
-
-public:
-    template<class Fn, class... Args>
-    event(Fn&& fn, Args&&... args): 
-        __impl(__make_shared_impl(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...))) {}
-
-    void complete() { __impl->complete(); }
-
-    id get_id() const { return id(__impl->__native_handle()); }
-
-    template<class Fn>
-    st::shared_ptr<basic_impl<Fn>> __make_shared_impl(Fn&& fn) {
-        return std::make_shared(std::forward<Fn>(fn));
-    }
-
-};
-
-
-typedef basic_epoll<event_base> epoll;
-
 
 }
 
 
 #endif //FIBER_EPOLL_HPP
-
@@ -21,6 +21,8 @@
 
 namespace fiber {
 
+class kernel;
+
 class fiber_error: public std::runtime_error {
 public:
     explicit fiber_error(const std::string& what): std::runtime_error(what) { }
@@ -51,6 +53,8 @@ std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>&
 
 
 class __fiber_base {
+    friend class kernel;
+
 protected:
     class __impl_base;
 
@@ -64,7 +68,7 @@ public:
 };
 
 
-class __fiber_base::__impl_base {
+class __fiber_base::__impl_base: public std::enable_shared_from_this<__fiber_base::__impl_base> {
     friend class __fiber_base::__this_fiber_helper;
 
 protected:
@@ -75,6 +79,7 @@ protected:
         __unwind(__impl_base& impl) noexcept: __impl(impl) { __set_thread_impl(&__impl); }
         ~__unwind() noexcept {
             __set_thread_impl(__impl.__parent_impl);
+            if (__impl.__parent_impl) { __impl.__parent_impl->__set_status(fiber_status::running); }
             __impl.__set_status(fiber_status::dead);
         }
         __impl_base& __impl;
@@ -96,8 +101,11 @@ protected:
 
     inline void __set_status(fiber_status status) noexcept { __status = status; }
 
+    //the parent is whoever resumes us, so a fiber parked by one fiber can be resumed by the kernel
     void __set_resume() { 
         assert(__status == fiber_status::suspended);
+        __parent_impl = __thread_impl();
+        if (__parent_impl) { __parent_impl->__set_status(fiber_status::normal); }
         __set_thread_impl(this); 
         __set_status(fiber_status::running); 
     }
@@ -105,6 +113,7 @@ protected:
     void __set_yield() { 
         assert(__thread_impl() == this && __status == fiber_status::running);
         __set_thread_impl(__parent_impl); 
+        if (__parent_impl) { __parent_impl->__set_status(fiber_status::running); }
         __set_status(fiber_status::suspended); 
     }
 
@@ -120,6 +129,7 @@ private:
 
 class __fiber_base::__basic_impl: public __fiber_base::__impl_base { 
     friend class fiber;
+    friend class kernel;
     friend class __fiber_base::__this_fiber_helper;
 
 protected:
@@ -157,18 +167,23 @@ protected:
 #else
 private:
     ucontext_t __context; 
-    ucontext_t &__parent_context;
+    ucontext_t *__parent_context;
     char __stack[102400];
 
     static void __ucontext_entry(unsigned int hthis, unsigned int lthis) {
         __basic_impl *that = reinterpret_cast<__basic_impl *>((static_cast<unsigned long>(hthis) << 32) | lthis); 
 
-        __impl_base::__unwind _unwind(*that);
+        {
+            __impl_base::__unwind _unwind(*that);
 
-        //yield from here for complete construct of fiber
-        that->__yield();
+            //yield from here for complete construct of fiber
+            that->__yield();
+
+            that->__fiber_routine();
+        }
 
-        that->__fiber_routine();
+        //uc_link is fixed at makecontext, go back to the last resumer instead
+        ::setcontext(that->__parent_context);
     }
 
     void __routine() {
@@ -178,20 +193,20 @@ private:
         
         __context.uc_stack.ss_sp = __stack;
         __context.uc_stack.ss_size = sizeof(__stack);
-        __context.uc_link = &__parent_context;
+        __context.uc_link = nullptr;
 
         unsigned int hthis = static_cast<unsigned int>(reinterpret_cast<unsigned long>(this) >> 32);
         unsigned int lthis = static_cast<unsigned int>(reinterpret_cast<unsigned long>(this) & 0xffffffff);
         makecontext(&__context, reinterpret_cast<void (*)()>(__ucontext_entry), 2, hthis, lthis);
 
-        if (swapcontext(&__parent_context, &__context) != 0) {
+        if (swapcontext(__parent_context, &__context) != 0) {
             throw fiber_error("swapcontext error");
         }
     }
 
-    ucontext_t &__get_parent_context() {
+    ucontext_t *__get_parent_context() {
         static __thread ucontext_t _thread_context;
-        return __parent_impl ? static_cast<__basic_impl *>(__parent_impl)->__context : _thread_context;
+        return __parent_impl ? &static_cast<__basic_impl *>(__parent_impl)->__context : &_thread_context;
     }
 
 protected:
@@ -199,14 +214,15 @@ protected:
 
     void __yield() {
         __set_yield();
-        if (swapcontext(&__context, &__parent_context) != 0) {
+        if (swapcontext(&__context, __parent_context) != 0) {
             throw fiber_error("swapcontext error");
         }
     }
 
     void __resume() {
         __set_resume();
-        if (swapcontext(&__parent_context, &__context) != 0) {
+        __parent_context = __get_parent_context();
+        if (swapcontext(__parent_context, &__context) != 0) {
             throw fiber_error("swapcontext error");
         }
     }
@@ -220,10 +236,7 @@ class __fiber_base::__fiber_impl: public __fiber_base::__basic_impl {
     Fn __fn;
 
 public:
-    __fiber_impl(Fn&& fn): __fiber_base::__basic_impl(), __fn(std::forward<Fn>(fn)) {
-        //now, construct done and resume this fiber
-        __resume();
-    }
+    __fiber_impl(Fn&& fn): __fiber_base::__basic_impl(), __fn(std::forward<Fn>(fn)) { }
 
     void __fiber_routine() override { __fn(); }
 };
@@ -231,9 +244,14 @@ public:
 
 class __fiber_base::__this_fiber_helper {
     static __fiber_base::__basic_impl* __this_fiber_impl() {
-        return reinterpret_cast<__fiber_base::__basic_impl *>(__fiber_base::__impl_base::__thread_impl());
+        return static_cast<__fiber_base::__basic_impl *>(__fiber_base::__impl_base::__thread_impl());
     }
 public:
+    static std::shared_ptr<__fiber_base::__basic_impl> __shared_impl() {
+        __fiber_base::__basic_impl* impl = __this_fiber_impl();
+        assert(impl);
+        return std::static_pointer_cast<__fiber_base::__basic_impl>(impl->shared_from_this());
+    }
     static void __yield() { 
         __fiber_base::__basic_impl* impl = __this_fiber_impl();
         assert(impl);
@@ -279,7 +297,10 @@ public:
 
     template <class Fn, class... Args>
     explicit fiber(Fn&& fn, Args&&... args): 
-        __impl(__make_shared_impl(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...))) { }
+        __impl(__make_shared_impl(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...))) { 
+        //resume once the impl is owned, so the fiber can be parked by the kernel
+        __impl->__resume();
+    }
 
     ~fiber() noexcept { } 
 
@@ -1,20 +1,178 @@
 
 
+
 #ifndef FIBER_KERNEL_HPP
 #define FIBER_KERNEL_HPP
 
-#include <string>
-#include <iostream>
-#include <type_traits>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cerrno>
+
+#include <poll.h>
 
-#include "socket.hpp"
+#include "fiber.hpp"
+#include "epoll.hpp"
 
 namespace fiber {
 
 class kernel {
+public:
+    typedef int native_handle_type;
+    typedef epoll_base::events_type events_type;
+
+    static constexpr const events_type in = EPOLLIN;
+    static constexpr const events_type out = EPOLLOUT;
+    static constexpr const events_type err = EPOLLERR;
+
+private:
+    typedef std::shared_ptr<__fiber_base::__basic_impl> __fiber_ptr;
+
+    struct __io_event;
+
+    //one per fd this thread waited on. added to the reactor once, oneshot, and re-armed
+    //with EPOLL_CTL_MOD for what its waiters want, so readers and writers can share an fd
+    struct __fd_entry {
+        native_handle_type __fd = -1;
+        events_type __armed = 0;
+        bool __added = false;
+        __io_event *__waiters = nullptr;
+    };
+
+    //lives on the stack of the parked fiber
+    struct __io_event {
+        __fiber_ptr __fiber;
+        events_type __revents;
+        //the fd waited on and what for, waiters of one fd are linked by __fd_next
+        __fd_entry *__entry;
+        events_type __events;
+        __io_event *__fd_next;
+    };
+
+    typedef basic_epoll<__fd_entry> __reactor_type;
+
+    struct __thread_state {
+        std::deque<__fiber_ptr> __ready;
+        __reactor_type __reactor;
+        std::vector<std::unique_ptr<__fd_entry>> __fds;
+        std::size_t __waiting = 0;
+    };
+
+    static __thread_state& __this_state() {
+        static thread_local __thread_state _thread_state;
+        return _thread_state;
+    }
+
+    static void __suspend() { __fiber_base::__this_fiber_helper::__yield(); }
+
+    static bool __poll(native_handle_type fd, events_type events) noexcept {
+        pollfd pfd = { fd, static_cast<short>(events), 0 };
+        int ret;
+        while ((ret = ::poll(&pfd, 1, -1)) == -1 && errno == EINTR) { }
+        return ret == 1;
+    }
+
+    static void __wakeup(__thread_state& state, __io_event *ev, events_type events) {
+        ev->__revents = events;
+        __io_event **p = &ev->__entry->__waiters;
+        while (*p != ev) {
+            p = &(*p)->__fd_next;
+        }
+        *p = ev->__fd_next;
+        ev->__entry = nullptr;
+        state.__ready.push_back(std::move(ev->__fiber));
+        --state.__waiting;
+    }
+
+    static __fd_entry& __entry(__thread_state& state, native_handle_type fd) {
+        if (static_cast<std::size_t>(fd) >= state.__fds.size()) {
+            state.__fds.resize(fd + 1);
+        }
+        std::unique_ptr<__fd_entry>& entry = state.__fds[fd];
+        if (!entry) {
+            entry.reset(new __fd_entry());
+            entry->__fd = fd;
+        }
+        return *entry;
+    }
+
+    //make the registration report events too. with other waiters parked the fd is still
+    //open and a syscall is needed only for new events. the first waiter always re-arms:
+    //an fd closed and reused lost its registration, MOD fails and it is added again
+    static bool __arm(__thread_state& state, __fd_entry& entry, events_type events) {
+        events_type want = entry.__waiters ? entry.__armed | events : events;
+        if (entry.__waiters && entry.__armed == want) {
+            return true;
+        }
+        if (!entry.__added || !state.__reactor.modify(entry.__fd, want | EPOLLONESHOT, &entry)) {
+            if (!state.__reactor.push(entry.__fd, want | EPOLLONESHOT, &entry)) {
+                return false;
+            }
+            entry.__added = true;
+        }
+        entry.__armed = want;
+        return true;
+    }
+
+    //the oneshot fired: wake the waiters it is for, re-arm for the others
+    static void __on_ready(__thread_state& state, __fd_entry *entry, events_type events) {
+        entry->__armed = 0;
+        events_type rest = 0;
+        for (__io_event *ev = entry->__waiters, *next; ev; ev = next) {
+            next = ev->__fd_next;
+            if (events & (ev->__events | err | EPOLLHUP)) {
+                __wakeup(state, ev, events);
+            } else {
+                rest |= ev->__events;
+            }
+        }
+        if (rest && !__arm(state, *entry, rest)) {
+            //cannot happen for an fd that was armed, wake them to retry their syscall
+            while (entry->__waiters) {
+                __wakeup(state, entry->__waiters, err);
+            }
+        }
+    }
 
 public:
+    //park the calling fiber until fd is ready, outside a fiber just block in poll
+    static bool wait(native_handle_type fd, events_type events) {
+        if (!this_fiber::is_fiber()) {
+            return __poll(fd, events);
+        }
+        __thread_state& state = __this_state();
+        __fd_entry& entry = __entry(state, fd);
+        if (!__arm(state, entry, events)) {
+            return false;
+        }
+        __io_event ev = { __fiber_base::__this_fiber_helper::__shared_impl(), 0, &entry, events, entry.__waiters };
+        entry.__waiters = &ev;
+        ++state.__waiting;
+        __suspend();
+        //on err/hup let the caller retry its syscall and see the real errno
+        return true;
+    }
+
+    //run parked fibers until none is left on this thread
     static void run() {
+        assert(!this_fiber::is_fiber());
+        __thread_state& state = __this_state();
+        while (!state.__ready.empty() || state.__waiting) {
+            while (!state.__ready.empty()) {
+                __fiber_ptr f = std::move(state.__ready.front());
+                state.__ready.pop_front();
+                f->__resume();
+            }
+            if (!state.__waiting) {
+                break;
+            }
+            int ret = state.__reactor.wait([&state](__fd_entry *entry, events_type events) {
+                __on_ready(state, entry, events);
+            });
+            if (ret == -1) {
+                throw fiber_error("epoll_wait error");
+            }
+        }
     }
 
 };
@@ -23,4 +181,3 @@ public:
 
 
 #endif //FIBER_KERNEL_HPP
-
@@ -7,14 +7,23 @@
 //#include <iostream>
 #include <sstream>
 #include <ios>
+#include <tuple>
+#include <utility>
 #include <cstddef>
+#include <cstring>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/sendfile.h>
+
+#include "kernel.hpp"
 
 namespace fiber {
 
@@ -28,15 +37,17 @@ public:
     enum class family {
         ipv4 = 0,
         ipv6 = 1,
+        local = 2, //AF_UNIX
     };
     typedef unsigned short port_type;
     typedef sockaddr native_sockaddr_type;
     typedef socklen_t native_socklen_type; 
 
 private:
-    static constexpr const char* __inaddr_any_table[] = { "0.0.0.0", "::" };
-    static constexpr const int __native_family_table[] = { AF_INET, AF_INET6 };
-    static constexpr const native_socklen_type __native_socklen_table[] = { sizeof(sockaddr_in), sizeof(sockaddr_in6) }; 
+    static constexpr const char* __inaddr_any_table[] = { "0.0.0.0", "::", "" };
+    static constexpr const int __native_family_table[] = { AF_INET, AF_INET6, AF_UNIX };
+    static constexpr const native_socklen_type __native_socklen_table[] = { sizeof(sockaddr_in), sizeof(sockaddr_in6), sizeof(sockaddr_un) }; 
+    //inet only, local addrs have a path instead, see basic_socketaddr<family::local>
     static constexpr const size_t __port_offset_table[] = { offsetof(sockaddr_in, sin_port), offsetof(sockaddr_in6, sin6_port) }; 
     static constexpr const size_t __addr_offset_table[] = { offsetof(sockaddr_in, sin_addr), offsetof(sockaddr_in6, sin6_addr) };
 
@@ -121,6 +132,11 @@ public:
 
     inline const native_sockaddr_type* native_sockaddr() const { return &__sockaddr.s; }
 
+    inline native_socklen_type socklen() const noexcept { return native_socklen; }
+
+    //length reported by accept/recvfrom, fixed for inet
+    inline void socklen(native_socklen_type) noexcept { }
+
     port_type port() const { return htons(*__port_ptr()); } 
 
     std::string dotted_addr_only() const {
@@ -141,14 +157,182 @@ public:
     inline static family get_family() { return Family; }
 };
 
+//AF_UNIX path, a leading '@' names an abstract socket (sun_path[0] == 0, no trailing nul)
+template<>
+class basic_socketaddr<socketaddr_base::family::local>: public socketaddr_base {
+    union {
+        native_sockaddr_type s;
+        sockaddr_un un;
+    } __sockaddr;
+    native_socklen_type __socklen;
+
+public:
+    static constexpr const int native_family = __native_family(family::local);
+    static constexpr const char* inaddr_any = __inaddr_any(family::local);
+    static constexpr native_socklen_type native_socklen = __native_socklen(family::local);
+    static constexpr native_socklen_type native_max_socklen = sizeof(__sockaddr);
+    static constexpr size_t max_path = sizeof(sockaddr_un::sun_path) - 1;
+
+private:
+    static constexpr native_socklen_type path_offset = offsetof(sockaddr_un, sun_path);
+
+    void __init(const char *path, size_t len) {
+        __sockaddr.un.sun_family = native_family;
+        if (len > max_path) {
+            //throw
+            assert(false);
+        }
+        std::memcpy(__sockaddr.un.sun_path, path, len);
+        if (len && path[0] == '@') {
+            __sockaddr.un.sun_path[0] = '\0';
+            __socklen = path_offset + len;
+        } else {
+            __socklen = path_offset + len + 1;
+        }
+    }
+
+public:
+    //default, unnamed
+    basic_socketaddr(): __sockaddr(), __socklen(path_offset) { __sockaddr.un.sun_family = native_family; }
+
+    //from path
+    explicit basic_socketaddr(const std::string &path): basic_socketaddr(path.data(), path.size()) { }
+
+    //from path
+    explicit basic_socketaddr(const char *path): basic_socketaddr(path, std::strlen(path)) { }
+
+    //from path len
+    explicit basic_socketaddr(const char *path, size_t len): __sockaddr(), __socklen(0) {
+        __init(path, len);
+    }
+
+    //copy
+    basic_socketaddr(const basic_socketaddr& addr): __sockaddr(addr.__sockaddr), __socklen(addr.__socklen) {}
+
+    ~basic_socketaddr() = default;
+
+    basic_socketaddr& operator=(const basic_socketaddr& addr) {
+        __sockaddr = addr.__sockaddr;
+        __socklen = addr.__socklen;
+        return *this;
+    }
+
+    inline native_sockaddr_type* native_sockaddr() { return &__sockaddr.s; }
+
+    inline const native_sockaddr_type* native_sockaddr() const { return &__sockaddr.s; }
+
+    inline native_socklen_type socklen() const noexcept { return __socklen; }
+
+    inline void socklen(native_socklen_type len) noexcept { __socklen = len; }
+
+    port_type port() const { return 0; }
+
+    bool abstract() const noexcept { return __socklen > path_offset && __sockaddr.un.sun_path[0] == '\0'; }
+
+    std::string path() const {
+        if (__socklen <= path_offset) {
+            return std::string();
+        }
+        if (abstract()) {
+            return '@' + std::string(__sockaddr.un.sun_path + 1, __socklen - path_offset - 1);
+        }
+        return std::string(__sockaddr.un.sun_path, ::strnlen(__sockaddr.un.sun_path, __socklen - path_offset));
+    }
+
+    std::string dotted_addr_only() const { return path(); }
+
+    std::string dotted_addr() const { return path(); }
+
+public:
+    inline static family get_family() { return family::local; }
+};
+
 template<class CharT, class Traits, socketaddr_base::family Family>
 std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& out, basic_socketaddr<Family> addr) {
     out << addr.dotted_addr();
     return out;
 }
 
+//a setsockopt level/name pair with its value type, every kernel option is passed as int
+template<int Level, int Name, class T>
+class basic_sockopt {
+public:
+    typedef T value_type;
+
+    static constexpr const int level = Level;
+    static constexpr const int name = Name;
+
+    value_type value;
+
+    constexpr basic_sockopt() noexcept: value() { }
+
+    constexpr explicit basic_sockopt(value_type v) noexcept: value(v) { }
+};
+
+template<class T> struct __is_sockopt: std::false_type { };
+template<int Level, int Name, class T> struct __is_sockopt<basic_sockopt<Level, Name, T>>: std::true_type { };
+
+template<bool...> struct __bool_pack;
+template<bool... B> struct __all_of: std::is_same<__bool_pack<true, B...>, __bool_pack<B..., true>> { };
+
+namespace sockopt {
+
+typedef basic_sockopt<SOL_SOCKET, SO_REUSEADDR, bool> reuseaddr;
+typedef basic_sockopt<SOL_SOCKET, SO_REUSEPORT, bool> reuseport;
+typedef basic_sockopt<SOL_SOCKET, SO_SNDBUF, int> sndbuf;
+typedef basic_sockopt<SOL_SOCKET, SO_RCVBUF, int> rcvbuf;
+typedef basic_sockopt<SOL_SOCKET, SO_KEEPALIVE, bool> keepalive;
+typedef basic_sockopt<SOL_SOCKET, SO_BUSY_POLL, int> busy_poll;         //usec
+typedef basic_sockopt<SOL_SOCKET, SO_INCOMING_CPU, int> incoming_cpu;
+typedef basic_sockopt<SOL_SOCKET, SO_ZEROCOPY, bool> zerocopy;
+
+typedef basic_sockopt<IPPROTO_TCP, TCP_NODELAY, bool> tcp_nodelay;
+typedef basic_sockopt<IPPROTO_TCP, TCP_CORK, bool> tcp_cork;
+typedef basic_sockopt<IPPROTO_TCP, TCP_QUICKACK, bool> tcp_quickack;
+typedef basic_sockopt<IPPROTO_TCP, TCP_FASTOPEN, int> tcp_fastopen;    //pending syn queue length
+typedef basic_sockopt<IPPROTO_TCP, TCP_DEFER_ACCEPT, int> tcp_defer_accept; //sec
+typedef basic_sockopt<IPPROTO_TCP, TCP_KEEPIDLE, int> tcp_keepidle;    //sec
+typedef basic_sockopt<IPPROTO_TCP, TCP_KEEPINTVL, int> tcp_keepintvl;  //sec
+typedef basic_sockopt<IPPROTO_TCP, TCP_KEEPCNT, int> tcp_keepcnt;
+
+typedef basic_sockopt<SOL_UDP, UDP_GRO, bool> udp_gro;
+typedef basic_sockopt<SOL_UDP, UDP_SEGMENT, int> udp_segment;
+
+} //sockopt
+
+//options applied together right after the socket is created, before bind/connect
+template<class... Opts>
+class sockopt_set {
+    static_assert(__all_of<__is_sockopt<Opts>::value...>::value, "sockopt_set takes basic_sockopt types only");
+
+    std::tuple<Opts...> __opts;
+
+    template<class SocketT, std::size_t... I>
+    bool __apply(SocketT& s, std::index_sequence<I...>) const noexcept {
+        bool ret = true;
+        int _unpack[] = { 0, (ret = s.set_option(std::get<I>(__opts)) && ret, 0)... };
+        (void)_unpack;
+        return ret;
+    }
+
+public:
+    constexpr explicit sockopt_set(const Opts&... opts): __opts(opts...) { }
+
+    template<class SocketT>
+    bool apply(SocketT& s) const noexcept { return __apply(s, std::index_sequence_for<Opts...>()); }
+};
+
+template<class T> struct __is_sockopt_set: std::false_type { };
+template<class... Opts> struct __is_sockopt_set<sockopt_set<Opts...>>: std::true_type { };
+
+template<class... Args> struct __is_sockopt_set_first: std::false_type { };
+template<class First, class... Args> struct __is_sockopt_set_first<First, Args...>: __is_sockopt_set<typename std::decay<First>::type> { };
+
+template<class... Opts>
+constexpr sockopt_set<Opts...> make_sockopt_set(const Opts&... opts) { return sockopt_set<Opts...>(opts...); }
+
 class socket_base {
-    static constexpr const int __native_type_table[] = { SOCK_STREAM, SOCK_DGRAM };
+    static constexpr const int __native_type_table[] = { SOCK_STREAM, SOCK_DGRAM, SOCK_SEQPACKET };
 
 public:
     typedef socketaddr_base::family family;
@@ -156,6 +340,9 @@ public:
     enum class type {
         tcp = 0,
         udp = 1,
+        seqpacket = 2,
+        stream = tcp,
+        dgram = udp,
     };
 
 protected:
@@ -172,6 +359,21 @@ protected:
 
     virtual ~socket_base() noexcept { if (this->is_open()) { this->close(); } } 
 
+    //retry fn while it would block, parking the fiber until the socket is ready
+    template<class Fn>
+    ssize_t __io(kernel::events_type events, Fn&& fn) {
+        ssize_t ret;
+        while ((ret = fn()) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !kernel::wait(__socket, events)) {
+                break;
+            }
+        }
+        return ret;
+    }
+
 public:
     bool close() noexcept {
         bool ret = ::close(__socket) == 0;
@@ -192,6 +394,23 @@ public:
         return flags != -1 && fcntl(__socket, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) != -1;
     }
 
+    template<int Level, int Name, class T>
+    bool set_option(const basic_sockopt<Level, Name, T>& opt) noexcept {
+        int val = static_cast<int>(opt.value);
+        return ::setsockopt(__socket, Level, Name, &val, sizeof(val)) == 0;
+    }
+
+    template<int Level, int Name, class T>
+    bool get_option(basic_sockopt<Level, Name, T>& opt) const noexcept {
+        int val = 0;
+        socklen_t len = sizeof(val);
+        if (::getsockopt(__socket, Level, Name, &val, &len) != 0) {
+            return false;
+        }
+        opt.value = static_cast<T>(val);
+        return true;
+    }
+
 };
 
 
@@ -229,6 +448,17 @@ public:
 
     inline family get_family() const noexcept { return Family; }
 
+    //tcp options on tcp sockets, udp options on udp sockets, checked at compile time
+    template<int Level, int Name, class T>
+    bool set_option(const basic_sockopt<Level, Name, T>& opt) noexcept {
+        static_assert(Level != IPPROTO_TCP || (Type == type::tcp && Family != family::local), "tcp option on a non tcp socket");
+        static_assert(Level != SOL_UDP || Type == type::udp, "udp option on a non udp socket");
+        return socket_base::set_option(opt);
+    }
+
+    template<class... Opts>
+    bool set_option(const sockopt_set<Opts...>& opts) noexcept { return opts.apply(*this); }
+
     bool open(bool nonblock = false, int protocal = default_protocal) noexcept {
         __socket = ::socket(native_family, native_type, protocal); 
         if (!is_open()) {
@@ -239,7 +469,7 @@ public:
 
     template<class Addr, class = typename std::enable_if<is_same_decay<Addr, socketaddr_type>::value>::type>
     bool bind(Addr&& addr) noexcept {
-        return ::bind(__socket, addr.native_sockaddr(), addr.native_socklen) == 0;
+        return ::bind(__socket, addr.native_sockaddr(), addr.socklen()) == 0;
     }
 
     template<class... Args, class = typename std::enable_if<sizeof...(Args)>::type>
@@ -249,7 +479,7 @@ public:
 
     template<class Addr, class = typename std::enable_if<is_same_decay<Addr, socketaddr_type>::value>::type>
     bool connect(Addr&& addr) noexcept { 
-        return ::connect(this->__socket, addr.native_sockaddr(), addr.native_socklen) == 0;
+        return ::connect(this->__socket, addr.native_sockaddr(), addr.socklen()) == 0;
     }
 
     template<class... Args, class = typename std::enable_if<sizeof...(Args)>::type>
@@ -269,7 +499,7 @@ public:
 
     template<class Buf, class Addr, class = typename std::enable_if<is_same_decay<Addr, socketaddr_type>::value>::type>
     ssize_t send(Buf buf, size_t len, Addr&& addr) noexcept {
-        return ::sendto(buf, len, 0, addr.native_sockaddr(), addr.native_socklen); 
+        return ::sendto(this->__socket, buf, len, 0, addr.native_sockaddr(), addr.socklen()); 
     }
 
     template<class Buf, class... Args, class = typename std::enable_if<sizeof...(Args)>::type>
@@ -279,7 +509,10 @@ public:
 
     template<class Buf, class Addr, class = typename std::enable_if<is_same_decay<Addr, socketaddr_type>::value>::type>
     ssize_t recv(Buf buf, size_t len, Addr&& addr) noexcept {
-        return ::recv(buf, len, 0, addr.native_sockaddr(), addr.native_socklen);
+        typename socketaddr_type::native_socklen_type socklen = addr.native_max_socklen;
+        ssize_t ret = ::recvfrom(this->__socket, buf, len, 0, addr.native_sockaddr(), &socklen);
+        addr.socklen(socklen);
+        return ret;
     }
 
     template<class Buf, class... Args, class = typename std::enable_if<sizeof...(Args)>::type>
@@ -287,6 +520,47 @@ public:
         return this->recv(buf, len, socketaddr_type(std::forward<Args>(args)...));
     }
 
+    ssize_t sendmsg(const msghdr *msg, int flags = 0) {
+        return this->__io(kernel::out, [&] { return ::sendmsg(this->__socket, msg, flags); });
+    }
+
+    ssize_t recvmsg(msghdr *msg, int flags = 0) {
+        return this->__io(kernel::in, [&] { return ::recvmsg(this->__socket, msg, flags); });
+    }
+
+    //len bytes of file fd from offset, without copying through userspace, return sent bytes or -1
+    ssize_t send_file(int fd, off_t offset, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t ret = this->__io(kernel::out, [&] { return ::sendfile(this->__socket, fd, &offset, len - sent); });
+            if (ret <= 0) {
+                return ret == 0 || sent ? static_cast<ssize_t>(sent) : -1;
+            }
+            sent += ret;
+        }
+        return sent;
+    }
+
+    //allow MSG_ZEROCOPY sends, see basic_zerocopy_sender
+    bool zerocopy(bool on = true) noexcept { return this->set_option(sockopt::zerocopy(on)); }
+
+    // udp //
+
+    //up to n datagrams in one syscall, parks on EAGAIN, return count or -1
+    int recvmmsg(mmsghdr *msgs, unsigned int n, int flags = MSG_WAITFORONE) {
+        return static_cast<int>(this->__io(kernel::in, [&] { return ::recvmmsg(this->__socket, msgs, n, flags, nullptr); }));
+    }
+
+    int sendmmsg(mmsghdr *msgs, unsigned int n, int flags = 0) {
+        return static_cast<int>(this->__io(kernel::out, [&] { return ::sendmmsg(this->__socket, msgs, n, flags); }));
+    }
+
+    //receive coalesced datagrams, the segment size comes in a UDP_GRO cmsg
+    bool gro(bool on = true) noexcept { return this->set_option(sockopt::udp_gro(on)); }
+
+    //split every send into datagrams of size bytes, 0 to disable
+    bool segment(uint16_t size) noexcept { return this->set_option(sockopt::udp_segment(size)); }
+
     // tcp //
 
     bool listen(int backlog = default_backlog) noexcept {
@@ -301,11 +575,60 @@ public:
     basic_socket accept(socketaddr_type& addr) noexcept {
         typename socketaddr_type::native_socklen_type len = addr.native_max_socklen;
         native_handle_type s = ::accept(this->__socket, addr.native_sockaddr(), &len);
+        addr.socklen(len);
         return basic_socket(s);
     }
 
 };
 
+//move up to len bytes from one socket to another through a pipe until eof, 
+//bytes never enter userspace, return moved bytes or -1. a failed read after some
+//bytes returns what was moved, a failed write loses what is in the pipe and returns -1
+template<class SocketFrom, class SocketTo>
+ssize_t splice(SocketFrom& from, SocketTo& to, size_t len = static_cast<size_t>(-1), size_t chunk = 65536) {
+    int pipefd[2];
+    if (::pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return -1;
+    }
+    const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    size_t moved = 0;
+    bool error = false;
+    bool lost = false;
+    while (moved < len) {
+        size_t n = len - moved < chunk ? len - moved : chunk;
+        ssize_t in = -1;
+        while ((in = ::splice(from.native_handle(), nullptr, pipefd[1], nullptr, n, flags)) == -1) {
+            if (errno != EINTR && ((errno != EAGAIN && errno != EWOULDBLOCK) || !kernel::wait(from.native_handle(), kernel::in))) {
+                break;
+            }
+        }
+        if (in <= 0) {
+            error = in == -1;
+            break;
+        }
+        while (in > 0) {
+            ssize_t out = ::splice(pipefd[0], nullptr, to.native_handle(), nullptr, in, flags);
+            if (out == -1) {
+                if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && kernel::wait(to.native_handle(), kernel::out))) {
+                    continue;
+                }
+                error = lost = true;
+                break;
+            }
+            in -= out;
+            moved += out;
+        }
+        if (error) {
+            break;
+        }
+    }
+    int saved = errno;
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+    errno = saved;
+    return lost || (error && !moved) ? -1 : static_cast<ssize_t>(moved);
+}
+
 typedef basic_socketaddr<socketaddr_base::family::ipv4> socketaddr;
 typedef basic_socketaddr<socketaddr_base::family::ipv6> socketaddr6;
 
@@ -315,6 +638,13 @@ typedef basic_socket<socket_base::type::tcp, socket_base::family::ipv6> tcp6sock
 typedef basic_socket<socket_base::type::udp, socket_base::family::ipv4> udpsocket; 
 typedef basic_socket<socket_base::type::udp, socket_base::family::ipv6> udp6socket; 
 
+//same host ipc
+typedef basic_socketaddr<socketaddr_base::family::local> unixsocketaddr;
+
+typedef basic_socket<socket_base::type::stream, socket_base::family::local> unixsocket; 
+typedef basic_socket<socket_base::type::dgram, socket_base::family::local> unixdgramsocket; 
+typedef basic_socket<socket_base::type::seqpacket, socket_base::family::local> unixseqpacketsocket; 
+
 
 }
 
@@ -118,11 +118,21 @@ public:
         return true;
     }
 
-    template<class... Args>
+    template<class... Args, class = typename std::enable_if<!__is_sockopt_set_first<Args...>::value>::type>
     bool open(openmode mode, Args&&... args) noexcept { 
+        return this->open(mode, sockopt_set<>(), std::forward<Args>(args)...);
+    }
+
+    //opts are set before connect/bind
+    template<class... Opts, class... Args>
+    bool open(openmode mode, const sockopt_set<Opts...>& opts, Args&&... args) noexcept { 
         if (!mode || __socket.is_open() || !__socket.open(!(mode & sios_base::block))) {
             return false;
         }
+        if (!opts.apply(__socket)) {
+            __socket.close();
+            return false;
+        }
         if (mode & sios_base::conn) {
             return __socket.connect(std::forward<Args>(args)...) || (__socket.close(), false);
         }
@@ -139,6 +149,8 @@ public:
 
     const socket_type* socket() const noexcept { return &__socket; }
 
+    socket_type* socket() noexcept { return &__socket; }
+
     virtual basic_socketbuf* setbuf(char_type* s, streamsize n) noexcept {
         std::cout << "---> basic_socketbuf.setbuf" << std::endl;
         this->setg(s, s, s + n);
@@ -283,6 +295,8 @@ public:
 
     const socket_type* socket() const noexcept { return __socketbuf.socket(); }
 
+    socket_type* socket() noexcept { return __socketbuf.socket(); }
+
 };
 
 
@@ -321,9 +335,15 @@ public:
 
     void swap(basic_tcpacceptor& sa) noexcept { __socket.swap(sa.__socket); }
 
-    template<class... Args>
+    template<class... Args, class = typename std::enable_if<!__is_sockopt_set_first<Args...>::value>::type>
     void open(Args&&... args) { 
-        if (!__socket.open() || !__socket.bind(std::forward<Args>(args)...) || !__socket.listen(default_backlog)) {
+        this->open(sockopt_set<>(), std::forward<Args>(args)...);
+    } 
+
+    //opts are set before bind, e.g. reuseport or tcp_defer_accept
+    template<class... Opts, class... Args>
+    void open(const sockopt_set<Opts...>& opts, Args&&... args) { 
+        if (!__socket.open() || !opts.apply(__socket) || !__socket.bind(std::forward<Args>(args)...) || !__socket.listen(default_backlog)) {
             //throw
             assert(false);
         }
@@ -378,10 +398,22 @@ typedef basic_socketstream<udpsocket, char> udpstream;
 typedef basic_socketbuf<udp6socket, char> udp6buf;
 typedef basic_socketstream<udp6socket, char> udp6stream;
 
+//unix domain
+typedef basic_socketbuf<unixsocket, char> unixbuf;
+typedef basic_socketstream<unixsocket, char> unixstream;
+
+//unix domain seqpacket
+typedef basic_socketbuf<unixseqpacketsocket, char> unixseqpacketbuf;
+typedef basic_socketstream<unixseqpacketsocket, char> unixseqpacketstream;
+
 //tcp acceptor
 typedef basic_tcpacceptor<tcpstream> tcpacceptor; 
 typedef basic_tcpacceptor<tcp6stream> tcp6acceptor; 
 
+//unix domain acceptor
+typedef basic_tcpacceptor<unixstream> unixacceptor; 
+typedef basic_tcpacceptor<unixseqpacketstream> unixseqpacketacceptor; 
+
 
 }
 
@@ -0,0 +1,332 @@
+
+
+#ifndef FIBER_ZEROCOPY_HPP
+#define FIBER_ZEROCOPY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <chrono>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "socket.hpp"
+
+namespace fiber {
+
+//move-only payload, writable only while the caller owns it
+class zerocopy_buffer {
+    std::unique_ptr<char[]> __data;
+    std::size_t __size;
+
+public:
+    zerocopy_buffer() noexcept: __data(), __size(0) { }
+
+    explicit zerocopy_buffer(std::size_t size): __data(new char[size]), __size(size) { }
+
+    zerocopy_buffer(const void *data, std::size_t size): zerocopy_buffer(size) { std::memcpy(__data.get(), data, size); }
+
+    zerocopy_buffer(const zerocopy_buffer&) = delete;
+
+    zerocopy_buffer(zerocopy_buffer&& buf) noexcept: __data(std::move(buf.__data)), __size(buf.__size) { buf.__size = 0; }
+
+    zerocopy_buffer& operator=(const zerocopy_buffer&) = delete;
+
+    zerocopy_buffer& operator=(zerocopy_buffer&& buf) noexcept {
+        __data = std::move(buf.__data);
+        __size = buf.__size;
+        buf.__size = 0;
+        return *this;
+    }
+
+    char* data() noexcept { return __data.get(); }
+
+    const char* data() const noexcept { return __data.get(); }
+
+    std::size_t size() const noexcept { return __size; }
+
+    explicit operator bool() const noexcept { return static_cast<bool>(__data); }
+
+    //give the memory up without freeing it
+    char* release() noexcept {
+        __size = 0;
+        return __data.release();
+    }
+};
+
+
+//sends with MSG_ZEROCOPY, a buffer is held until the error queue reports every
+//send covering it complete, then handed to the recycle callback (or freed)
+template<class SocketT>
+class basic_zerocopy_sender {
+public:
+    typedef SocketT socket_type;
+    typedef zerocopy_buffer buffer_type;
+    typedef std::function<void(buffer_type&&)> recycle_type;
+
+    //below this, page pinning costs more than the copy
+    static const std::size_t default_copy_threshold = 16384;
+
+    static const std::size_t default_max_inflight = 64;
+
+    static const int default_drain_timeout = 1000;
+
+private:
+    struct __inflight {
+        uint32_t __first;
+        uint32_t __last;
+        uint32_t __pending;
+        buffer_type __buf;
+        //still being sent, kept even with nothing pending
+        bool __open;
+    };
+
+    socket_type& __socket;
+    recycle_type __recycle;
+    std::deque<__inflight> __queue;
+    uint32_t __next_id;
+    std::size_t __copy_threshold;
+    std::size_t __max_inflight;
+    int __drain_timeout;
+    bool __copied;
+
+    void __release(buffer_type&& buf) {
+        if (__recycle) {
+            __recycle(std::move(buf));
+        }
+    }
+
+    //ids are assigned per successful send call, ranges complete in order for tcp
+    void __complete(uint32_t lo, uint32_t hi) {
+        for (__inflight& f: __queue) {
+            if (!f.__pending || f.__first > hi || f.__last < lo) {
+                continue;
+            }
+            uint32_t first = f.__first > lo ? f.__first : lo;
+            uint32_t last = f.__last < hi ? f.__last : hi;
+            f.__pending -= last - first + 1;
+        }
+        __release_done();
+    }
+
+    void __release_done() {
+        while (!__queue.empty() && !__queue.front().__pending && !__queue.front().__open) {
+            __release(std::move(__queue.front().__buf));
+            __queue.pop_front();
+        }
+    }
+
+    //drain the error queue without blocking, return notifications read or -1
+    int __reap() {
+        int got = 0;
+        while (!__queue.empty()) {
+            char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (::recvmsg(__socket.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK ? got : -1;
+            }
+            ++got;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                sock_extended_err serr;
+                std::memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+                if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                __copied = __copied || (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                __complete(serr.ee_info, serr.ee_data);
+            }
+        }
+        return got;
+    }
+
+    //the error queue was empty after an err/hup wakeup: a socket error or a closed
+    //connection, nothing more will complete
+    bool __failed() noexcept {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        ::getsockopt(__socket.native_handle(), SOL_SOCKET, SO_ERROR, &error, &len);
+        errno = error ? error : EPIPE;
+        return false;
+    }
+
+    //park in the reactor until the error queue has something
+    bool __wait() {
+        if (!kernel::wait(__socket.native_handle(), kernel::err)) {
+            return false;
+        }
+        int got = __reap();
+        return got > 0 || (got == 0 && __failed());
+    }
+
+    //what the kernel may still read is never freed
+    void __leak() noexcept {
+        for (__inflight& f: __queue) {
+            f.__buf.release();
+        }
+        __queue.clear();
+    }
+
+    //__wait for the destructor. a cancelled fiber can not park, what is in flight goes to
+    //__reaper instead
+    void __drain() noexcept {
+        try {
+            while (!__queue.empty() && __wait()) { }
+            return;
+        } catch (const fiber_cancelled&) { }
+        int fd = ::fcntl(__socket.native_handle(), F_DUPFD_CLOEXEC, 0);
+        if (fd == -1) {
+            return __leak();
+        }
+        try {
+            fiber(__reaper, fd, std::move(__queue), __next_id, __drain_timeout);
+        } catch (...) {
+            ::close(fd);
+            __leak();
+        }
+    }
+
+    //detached, on a dup of the socket so it stays open: waits with cancellation deferred
+    //for the rest of the completions, up to timeout ms. buffers are freed, not recycled,
+    //whatever recycle refers to may be gone
+    static void __reaper(int fd, std::deque<__inflight>& queue, uint32_t next_id, int timeout) {
+        socket_type s(fd);
+        basic_zerocopy_sender zc(s);
+        zc.__queue = std::move(queue);
+        zc.__next_id = next_id;
+        kernel::defer_cancel defer;
+        kernel::clock_type::time_point deadline = kernel::clock_type::now() + std::chrono::milliseconds(timeout);
+        while (!zc.__queue.empty()) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - kernel::clock_type::now()).count();
+            if (ms <= 0 || !kernel::wait(fd, kernel::err, static_cast<int>(ms))) {
+                break;
+            }
+            //nothing after an err/hup wakeup, the socket failed
+            if (zc.__reap() <= 0) {
+                break;
+            }
+        }
+        zc.__leak();
+    }
+
+public:
+    explicit basic_zerocopy_sender(socket_type& s, recycle_type recycle = recycle_type()):
+        __socket(s), __recycle(std::move(recycle)), __queue(), __next_id(0),
+        __copy_threshold(default_copy_threshold), __max_inflight(default_max_inflight),
+        __drain_timeout(default_drain_timeout), __copied(false) {
+        __socket.zerocopy();
+    }
+
+    basic_zerocopy_sender(const basic_zerocopy_sender&) = delete;
+
+    //in-flight pages may not be reused before the kernel is done with them
+    ~basic_zerocopy_sender() {
+        if (__socket.is_open() && __reap() != -1) {
+            __drain();
+        }
+    }
+
+    basic_zerocopy_sender& operator=(const basic_zerocopy_sender&) = delete;
+
+    void copy_threshold(std::size_t n) noexcept { __copy_threshold = n; }
+
+    void max_inflight(std::size_t n) noexcept { __max_inflight = n; }
+
+    //how long buffers left by a cancelled sender are waited for before they are leaked
+    void drain_timeout(int ms) noexcept { __drain_timeout = ms; }
+
+    std::size_t inflight() const noexcept { return __queue.size(); }
+
+    //the kernel fell back to copying (e.g. loopback), zerocopy only costs here
+    bool copied() const noexcept { return __copied; }
+
+    //send the whole buffer, return bytes sent or -1
+    ssize_t send(buffer_type&& buf) {
+        std::size_t size = buf.size();
+        bool zc = size >= __copy_threshold;
+        std::size_t offset = 0;
+        if (!zc) {
+            while (offset < size) {
+                ssize_t ret = __socket.send(buf.data() + offset, size - offset);
+                if (ret == -1) {
+                    break;
+                }
+                offset += ret;
+            }
+            __release(std::move(buf));
+        } else {
+            //queued before the first send, so completions of its own sends are counted
+            __queue.push_back(__inflight{ __next_id, __next_id, 0, std::move(buf), true });
+            while (offset < size) {
+                __inflight& f = __queue.back();
+                iovec iov = { f.__buf.data() + offset, size - offset };
+                msghdr msg;
+                std::memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                ssize_t ret = __socket.sendmsg(&msg, MSG_ZEROCOPY);
+                if (ret == -1 && errno == ENOBUFS && (__queue.size() > 1 || f.__pending) && __wait()) {
+                    //out of optmem for pinned pages, wait for earlier sends to free some
+                    continue;
+                }
+                if (ret == -1) {
+                    break;
+                }
+                offset += ret;
+                f.__last = __next_id++;
+                ++f.__pending;
+            }
+            __queue.back().__open = false;
+            __release_done();
+        }
+        if (__reap() == -1) {
+            return -1;
+        }
+        while (__queue.size() > __max_inflight) {
+            if (!__wait()) {
+                return -1;
+            }
+        }
+        return offset == size ? static_cast<ssize_t>(size) : -1;
+    }
+
+    ssize_t send(const void *data, std::size_t size) { return send(buffer_type(data, size)); }
+
+    //wait until every in-flight buffer is released
+    bool flush() {
+        if (__reap() == -1) {
+            return false;
+        }
+        while (!__queue.empty()) {
+            if (!__wait()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+typedef basic_zerocopy_sender<tcpsocket> tcpzerocopy;
+typedef basic_zerocopy_sender<tcp6socket> tcp6zerocopy;
+
+
+}
+
+
+#endif //FIBER_ZEROCOPY_HPP
@@ -0,0 +1,76 @@
+
+#include <string>
+
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "datagram.hpp"
+
+void test_mmsg() {
+    fiber::udpsocket rs;
+    rs.open(true);
+    bool bound = rs.bind("127.0.0.1", 8899);
+    assert(bound);
+    (void)bound;
+
+    fiber::fiber([&]() {
+            fiber::udpmmsgbuf rb;
+            int n = rb.recv(rs);
+            std::cout << "recv: " << n << std::endl;
+            for (std::size_t i = 0; i < rb.size(); ++i) {
+                std::cout << rb.addr(i) << "> " << std::string(rb.data(i), rb.length(i)) << std::endl;
+            }
+            assert(n == 3);
+        });
+
+    fiber::udpsocket ss;
+    ss.open();
+    fiber::udpmmsgbuf sb;
+    fiber::socketaddr addr("127.0.0.1", 8899);
+    for (const char *msg: { "one", "two", "three" }) {
+        sb.push(msg, std::strlen(msg), addr);
+    }
+    std::cout << "send: " << sb.send(ss) << std::endl;
+
+    fiber::kernel::run();
+}
+
+void test_gso() {
+    fiber::udpsocket rs;
+    rs.open(true);
+    assert(rs.bind("127.0.0.1", 8898));
+    std::cout << "gro: " << rs.gro() << std::endl;
+
+    fiber::fiber([&]() {
+            fiber::udpgsobuf rb;
+            std::size_t segments = 0;
+            while (segments < 4) {
+                rb.recv(rs);
+                for (std::size_t i = 0; i < rb.size(); ++i) {
+                    std::cout << "coalesced: " << rb.length(i) << " segment: " << rb.segment(i) << std::endl;
+                    for (auto seg: rb.segments(i)) {
+                        assert(seg.size == 1000 && seg.data[0] == char('a' + segments));
+                        ++segments;
+                    }
+                }
+            }
+        });
+
+    fiber::udpsocket ss;
+    ss.open();
+    std::string msg;
+    for (char c: { 'a', 'b', 'c', 'd' }) {
+        msg.append(1000, c);
+    }
+    fiber::udpgsobuf sb;
+    sb.push(msg.data(), msg.size(), fiber::socketaddr("127.0.0.1", 8898), 1000);
+    std::cout << "send: " << sb.send(ss) << std::endl;
+
+    fiber::kernel::run();
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    test_mmsg();
+    test_gso();
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+
+#include <cassert>
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "socketstream.hpp"
+#include "connector.hpp"
+
+//a value set is read back, the kernel may round buffer sizes up
+void test_single() {
+    fiber::tcpsocket s;
+    assert(s.open());
+    fiber::sockopt::tcp_nodelay nodelay;
+    assert(s.get_option(nodelay) && !nodelay.value);
+    assert(s.set_option(fiber::sockopt::tcp_nodelay(true)) && s.get_option(nodelay) && nodelay.value);
+
+    fiber::sockopt::tcp_keepidle idle;
+    assert(s.set_option(fiber::sockopt::tcp_keepidle(42)) && s.get_option(idle) && idle.value == 42);
+
+    fiber::sockopt::rcvbuf rcvbuf;
+    assert(s.set_option(fiber::sockopt::rcvbuf(65536)) && s.get_option(rcvbuf) && rcvbuf.value >= 65536);
+
+    //not a valid count, the old one stays
+    fiber::sockopt::tcp_keepcnt cnt;
+    errno = 0;
+    assert(!s.set_option(fiber::sockopt::tcp_keepcnt(-1)) && errno == EINVAL);
+    assert(s.get_option(cnt) && cnt.value > 0);
+
+    fiber::udpsocket u;
+    fiber::sockopt::reuseport reuseport;
+    assert(u.open() && u.set_option(fiber::sockopt::reuseport(true)) && u.get_option(reuseport) && reuseport.value);
+    std::cout << "single: rcvbuf " << rcvbuf.value << " keepcnt " << cnt.value << std::endl;
+}
+
+//every option of a set is tried, one that fails makes apply false
+void test_set() {
+    fiber::tcpsocket s;
+    assert(s.open());
+    auto opts = fiber::make_sockopt_set(fiber::sockopt::reuseaddr(true), fiber::sockopt::keepalive(true), fiber::sockopt::tcp_keepintvl(7));
+    assert(s.set_option(opts));
+    fiber::sockopt::reuseaddr reuseaddr;
+    fiber::sockopt::keepalive keepalive;
+    fiber::sockopt::tcp_keepintvl intvl;
+    assert(s.get_option(reuseaddr) && reuseaddr.value && s.get_option(keepalive) && keepalive.value);
+    assert(s.get_option(intvl) && intvl.value == 7);
+
+    fiber::tcpsocket t;
+    assert(t.open());
+    auto bad = fiber::make_sockopt_set(fiber::sockopt::tcp_keepcnt(-1), fiber::sockopt::tcp_nodelay(true));
+    assert(!bad.apply(t));
+    fiber::sockopt::tcp_nodelay nodelay;
+    assert(t.get_option(nodelay) && nodelay.value);
+    assert(fiber::sockopt_set<>().apply(t));
+    std::cout << "set: ok" << std::endl;
+}
+
+//options given to a connector are on the connected socket, an acceptor that cannot apply them throws
+void test_open() {
+    fiber::tcpsocket l;
+    assert(l.open() && l.bind("127.0.0.1", 0) && l.listen());
+    sockaddr_in in;
+    socklen_t len = sizeof(in);
+    ::getsockname(l.native_handle(), reinterpret_cast<sockaddr *>(&in), &len);
+    fiber::socketaddr::port_type port = ntohs(in.sin_port);
+    bool nodelay_on = false;
+    fiber::fiber([&] {
+            fiber::tcpconnector connector(1000);
+            fiber::tcpsocket s = connector.connect(fiber::socketaddr("127.0.0.1", port), fiber::make_sockopt_set(fiber::sockopt::tcp_nodelay(true)));
+            fiber::sockopt::tcp_nodelay nodelay;
+            nodelay_on = s.is_open() && s.get_option(nodelay) && nodelay.value;
+
+            //fails before connect, errno is what the option set
+            fiber::tcpsocket f = connector.connect(fiber::socketaddr("127.0.0.1", port), fiber::make_sockopt_set(fiber::sockopt::tcp_keepcnt(-1)));
+            assert(!f.is_open() && errno == EINVAL);
+        });
+    fiber::kernel::run();
+
+    bool thrown = false;
+    try {
+        fiber::tcpacceptor acceptor(fiber::make_sockopt_set(fiber::sockopt::tcp_keepcnt(-1)), 0);
+    } catch (const std::system_error& e) {
+        thrown = e.code().value() == EINVAL;
+    }
+    std::cout << "open: nodelay " << nodelay_on << " thrown " << thrown << std::endl;
+    assert(nodelay_on && thrown);
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    test_single();
+    test_set();
+    test_open();
+    std::cout << "ok" << std::endl;
+    return 0;
+}
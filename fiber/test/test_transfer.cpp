@@ -0,0 +1,122 @@
+
+#include <cassert>
+#include <csignal>
+#include <cerrno>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "socket.hpp"
+
+static std::string pattern(std::size_t size) {
+    std::string s(size, '\0');
+    for (std::size_t i = 0; i < size; ++i) {
+        s[i] = static_cast<char>('a' + i % 251 % 26);
+    }
+    return s;
+}
+
+//everything the peer sends until eof
+static std::string read_all(fiber::unixsocket& s) {
+    std::string got;
+    char buf[8192];
+    ssize_t n;
+    while ((n = s.recv(buf, sizeof(buf))) > 0) {
+        got.append(buf, n);
+    }
+    return got;
+}
+
+//a part of a file larger than the socket buffer, the sender parks until the reader drains it
+void test_send_file() {
+    std::string path = "/tmp/fiber_test_" + std::to_string(::getpid()) + "_transfer";
+    std::string content = pattern(1 << 20);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    assert(fd >= 0 && ::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+    ::unlink(path.c_str());
+
+    int sv[2];
+    assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == 0);
+    const off_t offset = 1000;
+    const std::size_t len = content.size() - 2000;
+    ssize_t sent = -1, past_end = -1;
+    std::string got;
+    fiber::fiber([&] {
+            fiber::unixsocket s(sv[0]);
+            sent = s.send_file(fd, offset, len);
+            //the end of the file stops it short
+            past_end = s.send_file(fd, content.size() - 10, 100);
+        });
+    fiber::fiber([&] {
+            fiber::unixsocket s(sv[1]);
+            got = read_all(s);
+        });
+    fiber::kernel::run();
+    ::close(fd);
+    std::cout << "send_file: " << sent << " " << past_end << std::endl;
+    assert(sent == static_cast<ssize_t>(len) && past_end == 10);
+    assert(got == content.substr(offset, len) + content.substr(content.size() - 10));
+}
+
+//a relay between two socket pairs, limited to len or until eof, and a peer that goes away
+void test_splice() {
+    int a[2], b[2];
+    assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, a) == 0);
+    assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, b) == 0);
+    std::string content = pattern(300000);
+    ssize_t first = -1, rest = -1;
+    std::string got;
+    fiber::fiber([&] {
+            fiber::unixsocket s(a[0]);
+            for (std::size_t off = 0; off < content.size();) {
+                ssize_t n = s.send(content.data() + off, content.size() - off);
+                assert(n > 0);
+                off += n;
+            }
+        });
+    fiber::fiber([&] {
+            fiber::unixsocket from(a[1]), to(b[0]);
+            first = fiber::splice(from, to, 100000, 4096);
+            rest = fiber::splice(from, to);
+        });
+    fiber::fiber([&] {
+            fiber::unixsocket s(b[1]);
+            got = read_all(s);
+        });
+    fiber::kernel::run();
+    std::cout << "splice: " << first << " " << rest << std::endl;
+    assert(first == 100000 && rest == 200000 && got == content);
+
+    //the reader of the far end is gone, what was piped is lost
+    assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, a) == 0);
+    assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, b) == 0);
+    ::close(b[1]);
+    ssize_t lost = 0;
+    int error = 0;
+    fiber::fiber([&] {
+            fiber::unixsocket s(a[0]);
+            s.send("data", 4);
+        });
+    fiber::fiber([&] {
+            fiber::unixsocket from(a[1]), to(b[0]);
+            lost = fiber::splice(from, to);
+            error = errno;
+        });
+    fiber::kernel::run();
+    std::cout << "splice lost: " << lost << " " << error << std::endl;
+    assert(lost == -1 && error == EPIPE);
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    //splice into a socket has no MSG_NOSIGNAL
+    std::signal(SIGPIPE, SIG_IGN);
+    test_send_file();
+    test_splice();
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,169 @@
+
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <vector>
+
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "zerocopy.hpp"
+
+//a connected pair on loopback, the accepted end in a
+static void connect_pair(fiber::tcpsocket& a, fiber::tcpsocket& b, uint16_t port) {
+    fiber::tcpsocket l;
+    bool ok = l.open() && l.set_option(fiber::sockopt::reuseaddr(true)) && l.bind("127.0.0.1", port) && l.listen();
+    ok = ok && b.open() && b.connect("127.0.0.1", port);
+    assert(ok);
+    (void)ok;
+    a = l.accept(true);
+    b.nonblocking();
+}
+
+void test_send() {
+    fiber::tcpsocket rs, ss;
+    connect_pair(rs, ss, 8897);
+    const std::size_t count = 200, size = 65536;
+    std::size_t recycled = 0, received = 0;
+
+    fiber::fiber([&] {
+            std::vector<char> buf(size);
+            ssize_t n;
+            while ((n = rs.recv(buf.data(), buf.size())) > 0) {
+                received += n;
+            }
+        });
+
+    fiber::fiber([&] {
+            {
+                fiber::tcpzerocopy zc(ss, [&](fiber::zerocopy_buffer&&) { ++recycled; });
+                for (std::size_t i = 0; i < count; ++i) {
+                    fiber::zerocopy_buffer buf(size);
+                    std::memset(buf.data(), 'a' + i % 26, size);
+                    ssize_t sent = zc.send(std::move(buf));
+                    assert(sent == static_cast<ssize_t>(size));
+                    (void)sent;
+                }
+                //below the threshold it is copied and released at once
+                ssize_t small = zc.send("small", 5);
+                assert(small == 5);
+                (void)small;
+                //the destructor waits for what is still in flight
+                std::cout << "inflight: " << zc.inflight() << " copied: " << zc.copied() << std::endl;
+            }
+            assert(recycled == count + 1);
+            ::shutdown(ss.native_handle(), SHUT_WR);
+        });
+
+    fiber::kernel::run();
+    std::cout << "received: " << received << " recycled: " << recycled << std::endl;
+    assert(received == count * size + 5);
+}
+
+void test_reset() {
+    fiber::tcpsocket rs, ss;
+    connect_pair(rs, ss, 8896);
+    bool failed = false;
+
+    fiber::fiber([&] {
+            fiber::tcpzerocopy zc(ss);
+            //nobody reads, the peer goes away with data unread
+            fiber::fiber([&] { fiber::kernel::sleep(10); rs.close(); });
+            while (zc.send(fiber::zerocopy_buffer(1 << 20)) != -1) { }
+            //a failed socket ends the flush instead of spinning on EPOLLERR
+            failed = !zc.flush() || !zc.inflight();
+        });
+
+    fiber::kernel::run();
+    std::cout << "reset ends flush: " << failed << std::endl;
+    assert(failed);
+}
+
+void test_cancel() {
+    fiber::tcpsocket rs, ss;
+    connect_pair(rs, ss, 8895);
+    bool unwound = false;
+
+    fiber::fiber([&] {
+            fiber::tcpzerocopy zc(ss);
+            zc.send(fiber::zerocopy_buffer(1 << 16));
+            try {
+                //parks until the reader below is cancelled, the destructor must not park then
+                char c;
+                ss.recv(&c, 1);
+            } catch (const fiber::fiber_cancelled&) {
+                unwound = true;
+                throw;
+            }
+        });
+
+    fiber::fiber([&] {
+            std::vector<char> buf(1 << 16);
+            std::size_t n = 0;
+            while (n < buf.size()) {
+                n += rs.recv(buf.data(), buf.size());
+            }
+            fiber::kernel::shutdown(0);
+        });
+
+    fiber::kernel::run();
+    assert(unwound);
+}
+
+//a sender cancelled with buffers in flight leaves them to a reaper fiber instead of
+//blocking the thread until the peer reads
+void test_cancel_inflight() {
+    fiber::tcpsocket rs, ss;
+    connect_pair(rs, ss, 8894);
+    const std::size_t count = 4, size = 1 << 16;
+    std::atomic<bool> done(false);
+    std::size_t inflight = 0, received = 0;
+    int ticks = 0;
+
+    std::thread reader([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            rs.nonblocking(false);
+            std::vector<char> buf(size);
+            while (received < count * size) {
+                ssize_t n = rs.recv(buf.data(), buf.size());
+                if (n <= 0) {
+                    break;
+                }
+                received += n;
+            }
+            done = true;
+        });
+
+    fiber::fiber([&] {
+            fiber::tcpzerocopy zc(ss);
+            for (std::size_t i = 0; i < count; ++i) {
+                zc.send(fiber::zerocopy_buffer(size));
+            }
+            inflight = zc.inflight();
+            char c;
+            ss.recv(&c, 1);
+        });
+    fiber::fiber([&] {
+            fiber::kernel::defer_cancel defer;
+            while (!done) {
+                fiber::kernel::sleep(1);
+                ++ticks;
+            }
+        });
+    fiber::fiber([] { fiber::kernel::sleep(5); fiber::kernel::shutdown(0); });
+
+    fiber::kernel::run();
+    reader.join();
+    std::cout << "cancel inflight: " << inflight << " ticks: " << ticks << " received: " << received << std::endl;
+    assert(received == count * size && ticks > 20);
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    test_send();
+    test_reset();
+    test_cancel();
+    test_cancel_inflight();
+    std::cout << "ok" << std::endl;
+    return 0;
+}